@@ -0,0 +1,313 @@
+// Copyright 2019-2020 CERN and copyright holders of ALICE O2.
+// See https://alice-o2.web.cern.ch/copyright for details of the copyright holders.
+// All rights not expressly granted are reserved.
+//
+// This software is distributed under the terms of the GNU General Public
+// License v3 (GPL Version 3), copied verbatim in the file "COPYING".
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+/// \file trackCounting.cxx
+/// \brief Compiled, headless front-end of the track counting macros: the fill stage reads the outputs of bjetTreeMerger.cxx once and writes the histograms to a results file, the plot stage produces the plots of sIP_distrib_N123.C, sIP_eff_mistag_jet_pT_N123.C and sIP_wp_scan_N123.C from a results file, in parallel processes or in one multi-page pdf. Built with the Makefile
+///
+/// \author Clement Lotteau <clement.lotteau@cern.ch> IP2I
+
+#include "sIP_analysis_N123.C"
+#include "sIP_bootstrap_N123.C"
+#include "sIP_wp_scan_N123.C"
+
+#include <ROOT/TProcessExecutor.hxx>
+#include <TSystem.h>
+
+#include <cstdlib>
+#include <cstring>
+
+constexpr const char *kTrackCountingResults = "trackCounting_results.root"; // default results file
+
+void printTrackCountingUsage()
+{
+    printf("usage: trackCounting fill [--threads N] [--tree NAME] [--no-skim] [--state FILE] [--output FILE]\n"
+           "                          [--bootstrap CUTS [--replicas N] [--ranks N] [--seed S]] INPUT\n"
+           "       trackCounting plot [--jobs N] [--ranks N] [--sIPmin X] [--scan CUTS] [--pdf FILE] [RESULTS]\n"
+           "\n"
+           "fill: fills the histograms of all the ranks with one read of INPUT (file, pattern or list of files) on N threads\n"
+           "      (0 = all the cores, default 1), accumulated in the state FILE if given, and writes them to the results file\n"
+           "      (default %s); with --bootstrap, also fills N replicas (default 200) of the N largest IP (default 3) in the\n"
+           "      same read (trees only, without state) and writes the rates and their bootstrap bands for the thresholds CUTS\n"
+           "      to sIP_bootstrap_N123.root\n"
+           "plot: produces the plots of the N largest IP (default 3) for the threshold X (cm, default 0.008) and the ROC curves\n"
+           "      from RESULTS (results or state file, default %s), on N processes (0 = all the cores, default), or in the\n"
+           "      single pdf FILE; with --scan, also writes the rates for the thresholds CUTS (\"0.004,0.008\" or \"min:max:n\")\n"
+           "      and the ROC curves to sIP_wp_scan_N123.root\n",
+           kTrackCountingResults, kTrackCountingResults);
+}
+
+/// Value of the option following argv[i], exits if it is missing
+const char *trackCountingOption(int argc, char **argv, int &i)
+{
+    if (i + 1 >= argc)
+    {
+        printf("trackCounting: missing value of %s\n", argv[i]);
+        printTrackCountingUsage();
+        exit(2);
+    }
+    return argv[++i];
+}
+
+/// Renders each page in its pdf file on nJobs processes (0 = all the cores), forked once the histograms are ready,
+/// or all the pages in the multi-page pdf singlePdf if not null. Returns the number of pages which could not be written.
+int renderTrackCountingPages(const std::vector<TrackCountingPage> &pages, int nJobs, const char *singlePdf)
+{
+    if (singlePdf)
+    {
+        TCanvas canvas("c_trackCounting", "c_trackCounting");
+        canvas.Print(Form("%s[", singlePdf));
+        for (const auto &page : pages)
+        {
+            canvas.Clear();
+            page.draw(&canvas);
+            canvas.Print(singlePdf, Form("Title:%s", page.name.c_str()));
+        }
+        canvas.Print(Form("%s]", singlePdf));
+        return gSystem->AccessPathName(singlePdf) ? pages.size() : 0;
+    }
+
+    auto renderPage = [&](unsigned k) {
+        const TrackCountingPage &page = pages[k];
+        const std::string pdfName = page.name + ".pdf";
+        gSystem->Unlink(pdfName.c_str());
+        TCanvas canvas(Form("c_%s", page.name.c_str()), Form("c_%s", page.name.c_str()));
+        page.draw(&canvas);
+        canvas.SaveAs(pdfName.c_str());
+        return gSystem->AccessPathName(pdfName.c_str()) ? 1 : 0;
+    };
+    int nFailed = 0;
+    nJobs = std::min<int>(trackCountingThreads(nJobs), pages.size());
+    if (nJobs == 1)
+    {
+        for (unsigned k = 0; k < pages.size(); k++)
+        {
+            nFailed += renderPage(k);
+        }
+    }
+    else
+    {
+        ROOT::TProcessExecutor pool(nJobs);
+        for (int failed : pool.Map(renderPage, ROOT::TSeqU(pages.size())))
+        {
+            nFailed += failed;
+        }
+    }
+    return nFailed;
+}
+
+/// Fill stage: one pass over the input (or over its new entries, with a state file), histograms written to the results file,
+/// and bootstrap replicas filled in the same pass if requested, their rates and bands written to sIP_bootstrap_N123.root
+int fillTrackCounting(int argc, char **argv)
+{
+    int nThreads = 1;
+    const char *treeName = kTrackCountingTree;
+    const char *stateName = nullptr;
+    const char *outputName = kTrackCountingResults;
+    const char *input = nullptr;
+    bool useSkim = true;
+    const char *bootstrapCuts = nullptr;
+    int nReplicas = 200;
+    int nRanks = 3;
+    unsigned seed = 1;
+    for (int i = 2; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--threads"))
+        {
+            nThreads = atoi(trackCountingOption(argc, argv, i));
+        }
+        else if (!strcmp(argv[i], "--tree"))
+        {
+            treeName = trackCountingOption(argc, argv, i);
+        }
+        else if (!strcmp(argv[i], "--no-skim"))
+        {
+            useSkim = false;
+        }
+        else if (!strcmp(argv[i], "--state"))
+        {
+            stateName = trackCountingOption(argc, argv, i);
+        }
+        else if (!strcmp(argv[i], "--output"))
+        {
+            outputName = trackCountingOption(argc, argv, i);
+        }
+        else if (!strcmp(argv[i], "--bootstrap"))
+        {
+            bootstrapCuts = trackCountingOption(argc, argv, i);
+        }
+        else if (!strcmp(argv[i], "--replicas"))
+        {
+            nReplicas = atoi(trackCountingOption(argc, argv, i));
+        }
+        else if (!strcmp(argv[i], "--ranks"))
+        {
+            nRanks = atoi(trackCountingOption(argc, argv, i));
+        }
+        else if (!strcmp(argv[i], "--seed"))
+        {
+            seed = strtoul(trackCountingOption(argc, argv, i), nullptr, 10);
+        }
+        else if (!input and argv[i][0] != '-')
+        {
+            input = argv[i];
+        }
+        else
+        {
+            printTrackCountingUsage();
+            return 2;
+        }
+    }
+    if (!input)
+    {
+        printTrackCountingUsage();
+        return 2;
+    }
+    std::vector<double> sIPmin;
+    if (bootstrapCuts)
+    {
+        // the replica weights are drawn from the index of each file in the input, which changes when files are added
+        if (stateName)
+        {
+            printf("trackCounting: the bootstrap replicas cannot be accumulated in a state file\n");
+            return 2;
+        }
+        sIPmin = parseTrackCountingCuts(bootstrapCuts);
+        if (sIPmin.empty() or nReplicas < 2)
+        {
+            printf("trackCounting: at least one threshold and two replicas are needed for the bootstrap\n");
+            return 2;
+        }
+    }
+
+    // activating errors for all histograms
+    TH1::SetDefaultSumw2();
+
+    TrackCountingHistos histos;
+    bookSIPHistos(histos);
+    bookJetptSIPHistos(histos);
+    nRanks = std::max(1, std::min(nRanks, kNRanks));
+    std::unique_ptr<TrackCountingBootstrapBank> bootstrap(bootstrapCuts ? new TrackCountingBootstrapBank(nReplicas, nRanks, sIPmin, seed, true) : nullptr);
+    Long64_t nEntries;
+    if (stateName)
+    {
+        nEntries = runTrackCountingAccumulation(input, stateName, histos, nThreads, treeName);
+    }
+    else if (bootstrap)
+    {
+        nEntries = runTrackCountingPass(input, histos, *bootstrap, nThreads, treeName);
+    }
+    else
+    {
+        nEntries = runTrackCountingPass(input, histos, nThreads, treeName, useSkim);
+    }
+    if (nEntries < 0 or !writeTrackCountingResults(outputName, histos))
+    {
+        return 1;
+    }
+    printf("trackCounting: histograms written to %s\n", outputName);
+    if (bootstrap)
+    {
+        plot_sIP_bootstrap_N123(histos, *bootstrap, nRanks, "sIP_bootstrap_N123.root", false);
+    }
+    return 0;
+}
+
+/// Plot stage: plots of sIP_distrib_N123.C, sIP_eff_mistag_jet_pT_N123.C and ROC curves (and working point scan) of sIP_wp_scan_N123.C from a results file, without reading the tree
+int plotTrackCounting(int argc, char **argv)
+{
+    int nJobs = 0;
+    int nRanks = 3;
+    double sIPmin = 0.008;
+    const char *singlePdf = nullptr;
+    const char *inputName = nullptr;
+    const char *cuts = nullptr;
+    for (int i = 2; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--jobs"))
+        {
+            nJobs = atoi(trackCountingOption(argc, argv, i));
+        }
+        else if (!strcmp(argv[i], "--ranks"))
+        {
+            nRanks = atoi(trackCountingOption(argc, argv, i));
+        }
+        else if (!strcmp(argv[i], "--sIPmin"))
+        {
+            sIPmin = atof(trackCountingOption(argc, argv, i));
+        }
+        else if (!strcmp(argv[i], "--scan"))
+        {
+            cuts = trackCountingOption(argc, argv, i);
+        }
+        else if (!strcmp(argv[i], "--pdf"))
+        {
+            singlePdf = trackCountingOption(argc, argv, i);
+        }
+        else if (!inputName and argv[i][0] != '-')
+        {
+            inputName = argv[i];
+        }
+        else
+        {
+            printTrackCountingUsage();
+            return 2;
+        }
+    }
+    nRanks = std::max(1, std::min(nRanks, kNRanks));
+
+    // activating errors for all histograms
+    TH1::SetDefaultSumw2();
+
+    TrackCountingHistos histos;
+    bookSIPHistos(histos);
+    bookJetptSIPHistos(histos);
+    if (!readTrackCountingResults(inputName ? inputName : kTrackCountingResults, histos))
+    {
+        return 1;
+    }
+    finalizeTrackCountingHistos(histos);
+    normalize_sIP_distrib_N123(histos, nRanks);
+    TrackCountingRates rates = compute_sIP_eff_mistag_jet_pT_N123(histos, sIPmin, nRanks);
+    TrackCountingROCs rocs = compute_sIP_roc_N123(histos, nRanks);
+    if (cuts)
+    {
+        const std::vector<double> scanCuts = parseTrackCountingCuts(cuts);
+        if (scanCuts.empty())
+        {
+            return 2;
+        }
+        scan_sIP_wp_N123(histos, scanCuts, rocs, nRanks);
+    }
+
+    TStopwatch timer;
+    const std::vector<TrackCountingPage> pages = trackCountingPages(histos, rates, rocs, nRanks);
+    const int nFailed = renderTrackCountingPages(pages, nJobs, singlePdf);
+    timer.Stop();
+    printf("trackCounting: %zu plots rendered in %.2f s%s\n", pages.size() - nFailed, timer.RealTime(), nFailed > 0 ? Form(", %d could not be written", nFailed) : "");
+    return nFailed > 0 ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    // no display: the plots are only written to pdf files
+    gROOT->SetBatch(true);
+
+    if (argc >= 2 and !strcmp(argv[1], "fill"))
+    {
+        return fillTrackCounting(argc, argv);
+    }
+    if (argc >= 2 and !strcmp(argv[1], "plot"))
+    {
+        return plotTrackCounting(argc, argv);
+    }
+    printTrackCountingUsage();
+    return 2;
+}
@@ -0,0 +1,341 @@
+// Copyright 2019-2020 CERN and copyright holders of ALICE O2.
+// See https://alice-o2.web.cern.ch/copyright for details of the copyright holders.
+// All rights not expressly granted are reserved.
+//
+// This software is distributed under the terms of the GNU General Public
+// License v3 (GPL Version 3), copied verbatim in the file "COPYING".
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+/// \file trackCountingAccumulator.h
+/// \brief Incremental accumulation of the histograms of the track counting macros in a state file: only the entries of the outputs of bjetTreeMerger.cxx not read by the previous runs are read, with checkpoints of the state during the pass
+///
+/// \author Clement Lotteau <clement.lotteau@cern.ch> IP2I
+
+#ifndef TRACKCOUNTINGACCUMULATOR_H_
+#define TRACKCOUNTINGACCUMULATOR_H_
+
+#include "trackCountingEngine.h"
+
+#include <TNamed.h>
+
+#include <cstring>
+#include <map>
+#include <string>
+
+// The state file holds:
+//  - the sIP and jet pT vs. sIP histograms of all the flavor classes and ranks, with the names of bookSIPHistos and bookJetptSIPHistos
+//  - the name of the tree read (TNamed kStateTreeKey)
+//  - the tree kStateConsumedKey, with one entry per input file: name, entries [0, done) already added to the histograms,
+//    entries, size, modification time and UUID (TFile::GetUUID) of the file when it was last read
+constexpr const char *kStateTreeKey = "treeName";
+constexpr const char *kStateConsumedKey = "consumed";
+constexpr Long64_t kCheckpointEntries = 50000000; // default number of entries read between two checkpoints of the state
+constexpr int kMaxFileName = 4096;                // maximum length of the input file names in the state
+constexpr int kUUIDLength = 37;                   // length of the UUID of a file as a string (TUUID::AsString), with its terminating null
+
+/// Entries of an input file already added to the accumulated histograms
+struct TrackCountingConsumed
+{
+    Long64_t done = 0;     // entries [0, done) added
+    Long64_t entries = 0;  // entries of the tree when the file was last read
+    Long64_t size = 0;     // size of the file when it was last read
+    Long64_t mtime = 0;    // modification time of the file when it was last read
+    std::string uuid;      // UUID of the file, kept when entries are appended to it and new when the file is rewritten
+};
+
+/// Adds the histograms of the state file stateName to the booked histograms (both sets) and reads the consumed entries.
+/// A missing state file is an empty state. Returns false if the state cannot be read or was accumulated from another tree.
+inline bool loadTrackCountingState(const char *stateName, const char *treeName, TrackCountingHistos &histos, std::map<std::string, TrackCountingConsumed> &consumed)
+{
+    consumed.clear();
+    if (gSystem->AccessPathName(stateName))
+    {
+        return true;
+    }
+    std::unique_ptr<TFile> stateFile(TFile::Open(stateName));
+    if (!stateFile or stateFile->IsZombie())
+    {
+        printf("loadTrackCountingState: cannot open %s\n", stateName);
+        return false;
+    }
+    TNamed *stateTree = stateFile->Get<TNamed>(kStateTreeKey);
+    if (!stateTree or strcmp(stateTree->GetTitle(), treeName) != 0)
+    {
+        printf("loadTrackCountingState: %s was not accumulated from the tree %s\n", stateName, treeName);
+        return false;
+    }
+    for (int f = 0; f < kNFlavors; f++)
+    {
+        for (int n = 0; n < kNRanks; n++)
+        {
+            TH1F *sIP = stateFile->Get<TH1F>(histos.sIP[f][n]->GetName());
+            TH2D *jetpt_sIP = stateFile->Get<TH2D>(histos.jetpt_sIP[f][n]->GetName());
+            if (!sIP or !jetpt_sIP or !histos.sIP[f][n]->Add(sIP) or !histos.jetpt_sIP[f][n]->Add(jetpt_sIP))
+            {
+                printf("loadTrackCountingState: missing or incompatible histograms in %s\n", stateName);
+                return false;
+            }
+        }
+    }
+
+    TTree *consumedTree = stateFile->Get<TTree>(kStateConsumedKey);
+    if (!consumedTree)
+    {
+        printf("loadTrackCountingState: no list of consumed entries in %s\n", stateName);
+        return false;
+    }
+    char fileName[kMaxFileName];
+    char uuid[kUUIDLength] = "";
+    TrackCountingConsumed entry;
+    consumedTree->SetBranchAddress("fileName", fileName);
+    consumedTree->SetBranchAddress("done", &entry.done);
+    consumedTree->SetBranchAddress("entries", &entry.entries);
+    consumedTree->SetBranchAddress("size", &entry.size);
+    consumedTree->SetBranchAddress("mtime", &entry.mtime);
+    if (consumedTree->GetBranch("uuid")) // not recorded by the first versions of the state
+    {
+        consumedTree->SetBranchAddress("uuid", uuid);
+    }
+    for (Long64_t i = 0; i < consumedTree->GetEntries(); i++)
+    {
+        consumedTree->GetEntry(i);
+        entry.uuid = uuid;
+        consumed[fileName] = entry;
+    }
+    return true;
+}
+
+/// Writes the histograms (both sets) and the consumed entries to the state file stateName.
+/// The state is written to a temporary file renamed at the end, so that an interrupted checkpoint never replaces the previous one.
+inline bool saveTrackCountingState(const char *stateName, const char *treeName, const TrackCountingHistos &histos, const std::map<std::string, TrackCountingConsumed> &consumed)
+{
+    const std::string tmpName = std::string(stateName) + ".tmp";
+    std::unique_ptr<TFile> stateFile(TFile::Open(tmpName.c_str(), "RECREATE"));
+    if (!stateFile or stateFile->IsZombie())
+    {
+        printf("saveTrackCountingState: cannot create %s\n", tmpName.c_str());
+        return false;
+    }
+    bool ok = true;
+    for (int f = 0; f < kNFlavors; f++)
+    {
+        for (int n = 0; n < kNRanks; n++)
+        {
+            ok = ok and stateFile->WriteTObject(histos.sIP[f][n]) > 0 and stateFile->WriteTObject(histos.jetpt_sIP[f][n]) > 0;
+        }
+    }
+    TNamed stateTree(kStateTreeKey, treeName);
+    ok = ok and stateFile->WriteTObject(&stateTree) > 0;
+
+    // the tree is owned by the file
+    stateFile->cd();
+    TTree *consumedTree = new TTree(kStateConsumedKey, "entries of the input files added to the histograms");
+    char fileName[kMaxFileName];
+    char uuid[kUUIDLength];
+    TrackCountingConsumed entry;
+    consumedTree->Branch("fileName", fileName, "fileName/C");
+    consumedTree->Branch("done", &entry.done, "done/L");
+    consumedTree->Branch("entries", &entry.entries, "entries/L");
+    consumedTree->Branch("size", &entry.size, "size/L");
+    consumedTree->Branch("mtime", &entry.mtime, "mtime/L");
+    consumedTree->Branch("uuid", uuid, "uuid/C");
+    for (const auto &file : consumed)
+    {
+        strncpy(fileName, file.first.c_str(), kMaxFileName - 1);
+        fileName[kMaxFileName - 1] = '\0';
+        entry = file.second;
+        strncpy(uuid, entry.uuid.c_str(), kUUIDLength - 1);
+        uuid[kUUIDLength - 1] = '\0';
+        consumedTree->Fill();
+    }
+    ok = ok and consumedTree->Write() > 0;
+    stateFile->Close();
+
+    if (!ok or rename(tmpName.c_str(), stateName) != 0)
+    {
+        printf("saveTrackCountingState: cannot write %s\n", stateName);
+        remove(tmpName.c_str());
+        return false;
+    }
+    return true;
+}
+
+/// Splits the entries [first, nEntries) of the tree in contiguous ranges of about chunkEntries entries, aligned on the clusters of the tree
+inline std::vector<std::pair<Long64_t, Long64_t>> trackCountingPendingRanges(TTree *mytree, Long64_t first, Long64_t nEntries, Long64_t chunkEntries)
+{
+    std::vector<Long64_t> clusterStarts;
+    TTree::TClusterIterator clusterIter = mytree->GetClusterIterator(first);
+    Long64_t start;
+    while ((start = clusterIter()) < nEntries)
+    {
+        if (start > first)
+        {
+            clusterStarts.push_back(start);
+        }
+    }
+
+    std::vector<std::pair<Long64_t, Long64_t>> ranges;
+    size_t iCluster = 0;
+    while (first < nEntries)
+    {
+        // first cluster starting after chunkEntries entries
+        while (iCluster < clusterStarts.size() and clusterStarts[iCluster] < first + chunkEntries)
+        {
+            iCluster++;
+        }
+        const Long64_t last = iCluster == clusterStarts.size() ? nEntries : clusterStarts[iCluster];
+        ranges.emplace_back(first, last);
+        first = last;
+    }
+    return ranges;
+}
+
+/// Accumulates in the state file stateName the histograms of the input files (see expandTrackCountingInput) and fills the
+/// booked histograms (both sets) with the accumulated state. Only the entries not added by the previous runs are read:
+/// new files, and new entries of files which grew. A file is considered to have grown only if it has the UUID recorded
+/// in the state (entries appended to the same file); a file rewritten since it was read (e.g. replaced by another
+/// production, with a new UUID) or with fewer entries than already added is reported and skipped. The entries are read by rounds of about checkpointEntries entries on
+/// nThreads threads (0 = all the cores), and the state is written after each round, so that an interrupted pass resumes
+/// from the last round written. The trees are read directly (the entries being read once, skims are not built).
+/// Input files which cannot be opened are reported and skipped (they are not recorded in the state).
+/// Returns the number of entries read by this run, -1 if the state could not be read or written or if a range of entries could not be read.
+inline Long64_t runTrackCountingAccumulation(const char *input, const char *stateName, TrackCountingHistos &histos, int nThreads = 1, const char *treeName = kTrackCountingTree,
+                                             Long64_t checkpointEntries = kCheckpointEntries)
+{
+    if (!histos.hasSIP() or !histos.hasJetptSIP())
+    {
+        printf("runTrackCountingAccumulation: both sets of histograms must be booked\n");
+        return -1;
+    }
+    TStopwatch timer;
+    std::map<std::string, TrackCountingConsumed> consumed;
+    if (!loadTrackCountingState(stateName, treeName, histos, consumed))
+    {
+        return -1;
+    }
+    nThreads = trackCountingThreads(nThreads);
+    const Long64_t chunkEntries = std::max(1LL, checkpointEntries / nThreads);
+
+    // ranges of entries not added yet, in the order of the input files
+    struct Pending
+    {
+        std::string fileName;
+        Long64_t first, last;
+    };
+    std::vector<Pending> pending;
+    std::map<std::string, TrackCountingConsumed> current; // state of the files with pending entries
+    int nUpToDate = 0, nFailedFiles = 0;
+    bool touched = false; // files modified without new entries
+    for (const auto &fileName : expandTrackCountingInput(input, treeName))
+    {
+        FileStat_t source{};
+        const bool local = gSystem->GetPathInfo(fileName.c_str(), source) == 0;
+        auto previous = consumed.find(fileName);
+        if (local and previous != consumed.end() and previous->second.size == source.fSize and previous->second.mtime == source.fMtime and
+            previous->second.done == previous->second.entries)
+        {
+            nUpToDate++;
+            continue;
+        }
+        std::unique_ptr<TFile> myFile;
+        TTree *mytree = openTrackCountingTree(fileName.c_str(), treeName, myFile);
+        if (!mytree)
+        {
+            nFailedFiles++;
+            continue;
+        }
+        const Long64_t nEntries = mytree->GetEntries();
+        const Long64_t done = previous == consumed.end() ? 0 : previous->second.done;
+        const std::string uuid = myFile->GetUUID().AsString();
+        if (previous != consumed.end() and previous->second.uuid != uuid)
+        {
+            printf("runTrackCountingAccumulation: WARNING %s was rewritten since its %lld entries were added (UUID %s instead of %s): skipped\n", fileName.c_str(), done, uuid.c_str(),
+                   previous->second.uuid.empty() ? "not recorded" : previous->second.uuid.c_str());
+            continue;
+        }
+        if (nEntries < done)
+        {
+            printf("runTrackCountingAccumulation: WARNING %s has %lld entries, fewer than the %lld already added: skipped\n", fileName.c_str(), nEntries, done);
+            continue;
+        }
+        if (nEntries == done)
+        {
+            consumed[fileName] = {done, nEntries, source.fSize, source.fMtime, uuid};
+            touched = true;
+            nUpToDate++;
+            continue;
+        }
+        for (const auto &range : trackCountingPendingRanges(mytree, done, nEntries, chunkEntries))
+        {
+            pending.push_back({fileName, range.first, range.second});
+        }
+        current[fileName] = {done, nEntries, source.fSize, source.fMtime, uuid};
+    }
+
+    // rounds of ranges, each added to the histograms and written to the state at once
+    Long64_t nEntries = 0;
+    for (size_t first = 0; first < pending.size();)
+    {
+        size_t last = first;
+        Long64_t roundEntries = 0;
+        while (last < pending.size() and (last == first or roundEntries + pending[last].last - pending[last].first <= checkpointEntries))
+        {
+            roundEntries += pending[last].last - pending[last].first;
+            last++;
+        }
+
+        TrackCountingBank bank(true, true);
+        std::atomic<int> nFailed(0);
+        runTrackCountingTasks(bank, last - first, nThreads, [&](unsigned k, TrackCountingBank &copy) {
+            const Pending &range = pending[first + k];
+            std::unique_ptr<TFile> myFile;
+            TTree *mytree = openTrackCountingTree(range.fileName.c_str(), treeName, myFile);
+            if (!mytree)
+            {
+                nFailed++;
+                return;
+            }
+            fillTrackCountingBank(mytree, copy, range.first, range.last);
+        });
+        if (nFailed > 0)
+        {
+            printf("runTrackCountingAccumulation: %d range(s) could not be read, %s is left at its last checkpoint\n", nFailed.load(), stateName);
+            return -1;
+        }
+
+        addTrackCountingBank(histos, bank);
+        finalizeTrackCountingHistos(histos);
+        for (size_t i = first; i < last; i++)
+        {
+            TrackCountingConsumed &file = current[pending[i].fileName];
+            file.done = pending[i].last;
+            consumed[pending[i].fileName] = file;
+        }
+        if (!saveTrackCountingState(stateName, treeName, histos, consumed))
+        {
+            return -1;
+        }
+        nEntries += roundEntries;
+        first = last;
+        printf("runTrackCountingAccumulation: checkpoint %lld new entries added to %s\n", nEntries, stateName);
+    }
+    if (pending.empty() and touched and !saveTrackCountingState(stateName, treeName, histos, consumed))
+    {
+        return -1;
+    }
+    finalizeTrackCountingHistos(histos);
+
+    timer.Stop();
+    if (nFailedFiles > 0)
+    {
+        printf("runTrackCountingAccumulation: WARNING %d input file(s) could not be read, they will be read by the next run\n", nFailedFiles);
+    }
+    printf("runTrackCountingAccumulation: %lld new entries read with %d thread(s) in %.1f s, %d file(s) up to date, %zu file(s) in %s\n", nEntries, nThreads, timer.RealTime(), nUpToDate,
+           consumed.size(), stateName);
+    return nEntries;
+}
+
+#endif // TRACKCOUNTINGACCUMULATOR_H_
@@ -0,0 +1,269 @@
+// Copyright 2019-2020 CERN and copyright holders of ALICE O2.
+// See https://alice-o2.web.cern.ch/copyright for details of the copyright holders.
+// All rights not expressly granted are reserved.
+//
+// This software is distributed under the terms of the GNU General Public
+// License v3 (GPL Version 3), copied verbatim in the file "COPYING".
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+/// \file trackCountingBootstrap.h
+/// \brief Bootstrap uncertainties of the efficiency and mistagging rates of the track counting tagger: Poisson replica weights attached to each jet during the pass over the outputs of bjetTreeMerger.cxx, replica counts kept for the working points only
+///
+/// \author Clement Lotteau <clement.lotteau@cern.ch> IP2I
+
+#ifndef TRACKCOUNTINGBOOTSTRAP_H_
+#define TRACKCOUNTINGBOOTSTRAP_H_
+
+#include "trackCountingEngine.h"
+#include "trackCountingScan.h"
+
+#include <TGraphAsymmErrors.h>
+
+#include <cmath>
+
+constexpr int kMaxBootstrapWeight = 15;       // largest Poisson weight drawn (P(w > 15) < 1e-13)
+constexpr double kBootstrapMemoryMB = 4096.;  // default memory budget of the replica counts (all the thread copies)
+
+/// Counter-based random numbers: the 64-bit mix of splitmix64, so that the weights of a jet depend only on the seed, the
+/// index of its file in the input and its entry, whatever the thread which reads it
+inline uint64_t trackCountingHash(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/// Key of the jet of an entry of the fileIndex-th input file, from which its replica weights are drawn
+inline uint64_t trackCountingJetKey(uint64_t seed, int fileIndex, Long64_t entry)
+{
+    return trackCountingHash(trackCountingHash(seed + fileIndex) + entry);
+}
+
+/// Bootstrap replicas of the jet pT vs. sIP counts, with the sIP axis reduced to the intervals between the working points:
+/// interval i holds the jets passing the i lowest thresholds. Each jet is added to every replica with a Poisson(1) weight.
+/// The counts are contiguous with the replicas innermost, [flavor][rank][jet pT bin][interval][replica], so that the weights
+/// of a jet, drawn once, are added to a contiguous row for each rank. The bank also holds the nominal (unweighted) counts:
+/// the jet pT vs. sIP histograms, and the sIP distributions if withSIP, so that all the histograms are filled in the same read.
+/// The replica counts are 32-bit: a jet pT bin and interval of a flavor class must hold fewer than about 4e9 jets.
+class TrackCountingBootstrapBank
+{
+  public:
+    static constexpr int kNBinsJetpt = kJetptAxis.nBins + 2;
+
+    /// nReplicas replicas of the nRanks largest IP for the sIP thresholds cuts (cm), weights drawn from seed
+    TrackCountingBootstrapBank(int nReplicas, int nRanks, const std::vector<double> &cuts, uint64_t seed, bool withSIP = false)
+        : nominal(withSIP, true), mNReplicas(nReplicas), mNRanks(nRanks), mCuts(cuts), mSeed(seed)
+    {
+        // thresholds rounded to the low edge of their sIP bin, as in trackCountingRate
+        std::sort(mCuts.begin(), mCuts.end());
+        mNIntervals = mCuts.size() + 1;
+        for (int y = 0; y < TrackCountingBank::kNBinsSIP; y++)
+        {
+            int i = 0;
+            while (i < (int)mCuts.size() and kSIPAxis.bin(mCuts[i]) <= y)
+            {
+                i++;
+            }
+            mInterval[y] = i;
+        }
+        // cumulative probabilities of the Poisson(1) distribution, scaled to 64-bit integers
+        double p = std::exp(-1.), cdf = 0;
+        for (int w = 0; w < kMaxBootstrapWeight; w++)
+        {
+            cdf += p;
+            p /= w + 1;
+            const double scaled = std::ldexp(cdf, 64);
+            mPoissonCDF[w] = scaled >= 18446744073709551615. ? UINT64_MAX : uint64_t(scaled);
+        }
+        mCounts.assign(size(), 0);
+        mWeights.resize(nReplicas);
+    }
+
+    /// Number of counts of a bank
+    size_t size() const { return size_t(kNFlavors) * mNRanks * kNBinsJetpt * mNIntervals * mNReplicas; }
+    /// Memory of the counts of a bank, nominal counts included (bytes)
+    size_t bytes() const
+    {
+        return size() * sizeof(uint32_t) + (TrackCountingBank::kSizeJetptSIP + (nominal.hasSIP() ? TrackCountingBank::kSizeSIP : 0)) * sizeof(uint64_t);
+    }
+
+    int nReplicas() const { return mNReplicas; }
+    int nRanks() const { return mNRanks; }
+    const std::vector<double> &cuts() const { return mCuts; }
+    uint64_t seed() const { return mSeed; }
+
+    /// Empty bank with the same replicas, filled by one thread
+    TrackCountingBootstrapBank emptyCopy() const { return TrackCountingBootstrapBank(mNReplicas, mNRanks, mCuts, mSeed, nominal.hasSIP()); }
+
+    /// Fills the nominal counts and the replicas with a jet of flavor class f, of key jetKey (see trackCountingJetKey)
+    void fill(uint64_t jetKey, int f, float jetpt, const float *signedIP2D)
+    {
+        nominal.fill(f, jetpt, signedIP2D);
+        for (int r = 0; r < mNReplicas; r++)
+        {
+            const uint64_t u = trackCountingHash(jetKey + r);
+            uint8_t w = 0;
+            while (w < kMaxBootstrapWeight and u >= mPoissonCDF[w])
+            {
+                w++;
+            }
+            mWeights[r] = w;
+        }
+        const int x = kJetptAxis.bin(jetpt);
+        for (int n = 0; n < mNRanks; n++)
+        {
+            uint32_t *counts = &mCounts[index(f, n, x, mInterval[kSIPAxis.bin(signedIP2D[n])], 0)];
+            for (int r = 0; r < mNReplicas; r++)
+            {
+                counts[r] += mWeights[r];
+            }
+        }
+    }
+
+    /// Adds the counts of another bank (filled by another thread)
+    void add(const TrackCountingBootstrapBank &other)
+    {
+        nominal.add(other.nominal);
+        for (size_t i = 0; i < mCounts.size(); i++)
+        {
+            mCounts[i] += other.mCounts[i];
+        }
+    }
+
+    /// Weighted count of the jets of flavor class f in the jet pT bin x passing the c-th threshold (all the jets if c < 0) for the (n+1)-th largest IP, in replica r
+    uint64_t passed(int f, int n, int x, int c, int r) const
+    {
+        uint64_t sum = 0;
+        for (int i = c + 1; i < mNIntervals; i++)
+        {
+            sum += mCounts[index(f, n, x, i, r)];
+        }
+        return sum;
+    }
+
+    TrackCountingBank nominal; // unweighted jet pT vs. sIP (and sIP) counts
+
+  private:
+    size_t index(int f, int n, int x, int i, int r) const { return ((size_t(f * mNRanks + n) * kNBinsJetpt + x) * mNIntervals + i) * mNReplicas + r; }
+
+    int mNReplicas, mNRanks, mNIntervals;
+    std::vector<double> mCuts;
+    uint64_t mSeed;
+    int mInterval[TrackCountingBank::kNBinsSIP]; // interval of each sIP bin
+    uint64_t mPoissonCDF[kMaxBootstrapWeight];  // P(w <= k) * 2^64
+    std::vector<uint32_t> mCounts;
+    std::vector<uint8_t> mWeights;               // weights of the jet being filled
+};
+
+/// Fills the bootstrap bank with the entries [first, last) of the tree of the fileIndex-th input file
+inline void fillTrackCountingBootstrap(TTree *mytree, TrackCountingBootstrapBank &bank, int fileIndex, Long64_t first, Long64_t last)
+{
+    forEachTrackCountingJet(mytree, true, first, last, [&bank, fileIndex](Long64_t entry, int f, const TrackCountingJet &jet) {
+        bank.fill(trackCountingJetKey(bank.seed(), fileIndex, entry), f, jet.jetpt, jet.signedIP2D);
+    });
+}
+
+/// Fills a bootstrap bank with one read of the trees of the input files (see expandTrackCountingInput), on nThreads threads
+/// (0 = all the cores) as runTrackCountingBankPass. Each thread fills its own copy of the bank: the number of threads is
+/// reduced so that the copies fit in memoryMB. The replica weights being drawn from the entry of each jet, the result does
+/// not depend on the number of threads. The trees are read directly (the skims do not keep the entry numbers).
+/// Returns the number of entries read, -1 if no file could be read or the bank does not fit in memory.
+inline Long64_t runTrackCountingBootstrapPass(const char *input, TrackCountingBootstrapBank &bank, int nThreads = 1, const char *treeName = kTrackCountingTree,
+                                              double memoryMB = kBootstrapMemoryMB)
+{
+    const std::vector<std::string> fileNames = expandTrackCountingInput(input, treeName);
+    if (fileNames.empty())
+    {
+        printf("runTrackCountingBootstrapPass: no input file for %s\n", input);
+        return -1;
+    }
+    // the bank and one copy per thread
+    const double bankMB = bank.bytes() / (1024. * 1024.);
+    const int maxThreads = int(memoryMB / bankMB) - 1;
+    if (maxThreads < 1)
+    {
+        printf("runTrackCountingBootstrapPass: %d replicas need %.0f MB per thread, more than the budget of %.0f MB: use fewer replicas, ranks or thresholds\n", bank.nReplicas(), bankMB, memoryMB);
+        return -1;
+    }
+    nThreads = trackCountingThreads(nThreads);
+    if (nThreads > maxThreads)
+    {
+        printf("runTrackCountingBootstrapPass: %d thread(s) instead of %d to fit the replicas (%.0f MB per thread) in %.0f MB\n", maxThreads, nThreads, bankMB, memoryMB);
+        nThreads = maxThreads;
+    }
+
+    printf("runTrackCountingBootstrapPass: %d replicas of %d rank(s) at %zu working point(s)\n", bank.nReplicas(), bank.nRanks(), bank.cuts().size());
+    return runTrackCountingFileTasks("runTrackCountingBootstrapPass", fileNames, bank, nThreads, [&](int fileIndex, int chunk, int nChunks, TrackCountingBootstrapBank &copy) {
+        return readTrackCountingChunkFromTree(fileNames[fileIndex].c_str(), treeName, chunk, nChunks, [&copy, fileIndex](TTree *mytree, Long64_t first, Long64_t last) {
+            fillTrackCountingBootstrap(mytree, copy, fileIndex, first, last);
+        });
+    });
+}
+
+/// Fills the booked histograms (the jet pT vs. sIP histograms must be booked) and the bootstrap replicas with one read of
+/// the trees of the input files, see runTrackCountingBootstrapPass. The bank must hold the nominal sIP counts (withSIP)
+/// if the sIP distributions are booked. Returns the number of entries read, -1 if no file could be read.
+inline Long64_t runTrackCountingPass(const char *input, TrackCountingHistos &histos, TrackCountingBootstrapBank &bootstrap, int nThreads = 1, const char *treeName = kTrackCountingTree,
+                                     double memoryMB = kBootstrapMemoryMB)
+{
+    if (!histos.hasJetptSIP() or histos.hasSIP() != bootstrap.nominal.hasSIP())
+    {
+        printf("runTrackCountingPass: the bootstrap bank does not hold the counts of the booked histograms\n");
+        return -1;
+    }
+    const Long64_t nEntries = runTrackCountingBootstrapPass(input, bootstrap, nThreads, treeName, memoryMB);
+    if (nEntries >= 0)
+    {
+        addTrackCountingBank(histos, bootstrap.nominal);
+        finalizeTrackCountingHistos(histos);
+    }
+    return nEntries;
+}
+
+/// Value of the quantile q of sorted values (linear interpolation between the closest ranks)
+inline double trackCountingQuantile(const std::vector<double> &sorted, double q)
+{
+    const double position = q * (sorted.size() - 1);
+    const size_t low = position;
+    const size_t high = std::min(low + 1, sorted.size() - 1);
+    return sorted[low] + (position - low) * (sorted[high] - sorted[low]);
+}
+
+/// Bootstrap uncertainty band of the efficiency (b jets) or mistagging rate (c, lf jets) vs. jet pT for the c-th threshold of
+/// the bank and the (n+1)-th largest IP: central values of nominal (see trackCountingRate), band from the 16% and 84% quantiles
+/// of the rates of the replicas, the replicas without jets in a jet pT bin being ignored
+inline TGraphAsymmErrors *trackCountingBootstrapBand(const TrackCountingBootstrapBank &bank, const TH1D *nominal, int f, int n, int c, const char *name)
+{
+    TGraphAsymmErrors *band = new TGraphAsymmErrors();
+    band->SetName(name);
+    std::vector<double> rates;
+    for (int x = 1; x <= kJetptAxis.nBins; x++)
+    {
+        rates.clear();
+        for (int r = 0; r < bank.nReplicas(); r++)
+        {
+            const uint64_t all = bank.passed(f, n, x, -1, r);
+            if (all > 0)
+            {
+                rates.push_back(double(bank.passed(f, n, x, c, r)) / all);
+            }
+        }
+        if (rates.empty())
+        {
+            continue;
+        }
+        std::sort(rates.begin(), rates.end());
+        const double rate = nominal->GetBinContent(x);
+        const double halfWidth = 0.5 * nominal->GetXaxis()->GetBinWidth(x);
+        const int point = band->GetN();
+        band->SetPoint(point, nominal->GetXaxis()->GetBinCenter(x), rate);
+        band->SetPointError(point, halfWidth, halfWidth, std::max(0., rate - trackCountingQuantile(rates, 0.16)), std::max(0., trackCountingQuantile(rates, 0.84) - rate));
+    }
+    return band;
+}
+
+#endif // TRACKCOUNTINGBOOTSTRAP_H_
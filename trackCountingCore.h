@@ -0,0 +1,497 @@
+// Copyright 2019-2020 CERN and copyright holders of ALICE O2.
+// See https://alice-o2.web.cern.ch/copyright for details of the copyright holders.
+// All rights not expressly granted are reserved.
+//
+// This software is distributed under the terms of the GNU General Public
+// License v3 (GPL Version 3), copied verbatim in the file "COPYING".
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+/// \file trackCountingCore.h
+/// \brief Histograms of the track counting tagger (flavor classes, ranks) and their flat bank, reading of the outputs of bjetTreeMerger.cxx and multi-threaded filling, shared by the analysis engine and the skim cache
+///
+/// \author Clement Lotteau <clement.lotteau@cern.ch> IP2I
+
+#ifndef TRACKCOUNTINGCORE_H_
+#define TRACKCOUNTINGCORE_H_
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TH1F.h>
+#include <TH2D.h>
+#include <TString.h>
+#include <TROOT.h>
+#include <ROOT/TSeq.hxx>
+#include <ROOT/TThreadExecutor.hxx>
+
+#include <algorithm>
+#include <cstdint>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// flavor classes of the tagger, used as first index of the histogram arrays
+enum TrackCountingFlavor
+{
+    kLf = 0, // none or light flavor
+    kC,      // charm
+    kB,      // beauty
+    kNFlavors
+};
+constexpr const char *kFlavorNames[kNFlavors] = {"lf", "c", "b"};
+
+constexpr int kNRanks = 10;    // number of largest IP studied (1st to 10th largest IP, all the tracks of mSignedIP2D)
+constexpr int kMaxTracks = 10; // size of the mSignedIP2D array in the tree
+constexpr Long64_t kTreeCacheSize = 64 * 1024 * 1024; // size of the TTreeCache (bytes)
+static_assert(kNRanks <= kMaxTracks, "the ranks studied must be stored in mSignedIP2D");
+
+constexpr int kFlavorColors[kNFlavors] = {4, 3, 2}; // lf in blue, c in green, b in red
+
+/// Uniform binning of an axis, with the bin numbering of TAxis (0 = underflow, nBins + 1 = overflow)
+struct TrackCountingAxis
+{
+    int nBins;
+    double min, max;
+
+    /// Bin of x, with the same rounding as TAxis::FindFixBin
+    int bin(double x) const { return x < min ? 0 : (x < max ? 1 + int(nBins * (x - min) / (max - min)) : nBins + 1); }
+};
+constexpr TrackCountingAxis kSIPAxis{400, -0.4, 0.4};  // sIP (cm)
+constexpr TrackCountingAxis kJetptAxis{195, 5., 200.}; // jet pT (GeV/c)
+
+/// Histograms produced by the engine, indexed by [flavor class][rank] (rank 0 = 1st largest IP).
+/// Only the booked histograms (non null) are filled.
+struct TrackCountingHistos
+{
+    TH1F *sIP[kNFlavors][kNRanks] = {};       // sIP distributions
+    TH2D *jetpt_sIP[kNFlavors][kNRanks] = {}; // jet pT vs. sIP
+
+    bool hasSIP() const { return sIP[0][0] != nullptr; }
+    bool hasJetptSIP() const { return jetpt_sIP[0][0] != nullptr; }
+};
+
+/// Flavor class of a jet from the mJetFlavor branch, -1 if the jet is not used
+inline int trackCountingFlavorClass(int flavor)
+{
+    if (flavor == 0 or flavor == 3) // flavor: none or light flavor
+    {
+        return kLf;
+    }
+    if (flavor == 1) // flavor: charm
+    {
+        return kC;
+    }
+    if (flavor == 2) // flavor: beauty
+    {
+        return kB;
+    }
+    return -1;
+}
+
+/// Title of a rank in the plots: 1st, 2nd, 3rd, 4th... largest IP
+inline const char *trackCountingRankTitle(int n)
+{
+    return Form("%d%s largest IP", n + 1, n == 0 ? "st" : (n == 1 ? "nd" : (n == 2 ? "rd" : "th")));
+}
+
+/// Common style of the histograms in the plots
+inline void setTrackCountingStyle(TH1 *h, int color)
+{
+    h->SetMarkerStyle(20);
+    h->SetMarkerSize(0.5);
+    h->SetMarkerColor(color);
+    h->SetLineColor(color);
+    h->SetLineWidth(2);
+    h->SetStats(0);
+}
+
+/// Books the sIP distributions (used by sIP_distrib_N123.C)
+inline void bookSIPHistos(TrackCountingHistos &histos)
+{
+    for (int f = 0; f < kNFlavors; f++)
+    {
+        for (int n = 0; n < kNRanks; n++)
+        {
+            histos.sIP[f][n] = new TH1F(Form("hist_sIP_%s_N%d", kFlavorNames[f], n + 1), Form("sIP_%s_N%d", kFlavorNames[f], n + 1), kSIPAxis.nBins, kSIPAxis.min, kSIPAxis.max);
+        }
+    }
+}
+
+/// Books the jet pT vs. sIP histograms (used by sIP_eff_mistag_jet_pT_N123.C)
+inline void bookJetptSIPHistos(TrackCountingHistos &histos)
+{
+    for (int f = 0; f < kNFlavors; f++)
+    {
+        for (int n = 0; n < kNRanks; n++)
+        {
+            histos.jetpt_sIP[f][n] = new TH2D(Form("hist_jetpt_sIP_%s_N%d", kFlavorNames[f], n + 1), Form("jetpt_sIP_%s_N%d", kFlavorNames[f], n + 1), kJetptAxis.nBins, kJetptAxis.min, kJetptAxis.max, kSIPAxis.nBins, kSIPAxis.min, kSIPAxis.max);
+        }
+    }
+}
+
+/// Flat bank of the counts of the sIP and jet pT vs. sIP histograms of NFlavors flavor classes and NRanks ranks,
+/// with sizes known at compile time, filled by the engine instead of the TH1 (one bank per thread).
+/// The counts of a histogram are contiguous, with the sIP bins innermost: [flavor][rank][sIP bin] and
+/// [flavor][rank][jet pT bin][sIP bin], under- and overflow bins included.
+template <int NFlavors, int NRanks>
+class TrackCountingBankT
+{
+  public:
+    static constexpr int kNBinsSIP = kSIPAxis.nBins + 2;
+    static constexpr int kNBinsJetpt = kJetptAxis.nBins + 2;
+    static constexpr size_t kSizeSIP = size_t(NFlavors) * NRanks * kNBinsSIP;
+    static constexpr size_t kSizeJetptSIP = size_t(NFlavors) * NRanks * kNBinsJetpt * kNBinsSIP;
+
+    TrackCountingBankT(bool withSIP, bool withJetptSIP) : mSIP(withSIP ? kSizeSIP : 0), mJetptSIP(withJetptSIP ? kSizeJetptSIP : 0) {}
+
+    bool hasSIP() const { return !mSIP.empty(); }
+    bool hasJetptSIP() const { return !mJetptSIP.empty(); }
+
+    /// Empty bank with the same histograms, filled by one thread
+    TrackCountingBankT emptyCopy() const { return TrackCountingBankT(hasSIP(), hasJetptSIP()); }
+
+    /// Fills the histograms of all the ranks with a jet of flavor class f: the sIP bins of all the ranks are computed in one loop
+    void fill(int f, float jetpt, const float *signedIP2D)
+    {
+        int sIPBins[NRanks];
+        for (int n = 0; n < NRanks; n++)
+        {
+            sIPBins[n] = kSIPAxis.bin(signedIP2D[n]);
+        }
+        mEntries[f]++;
+        if (hasSIP())
+        {
+            uint64_t *counts = &mSIP[size_t(f) * NRanks * kNBinsSIP];
+            for (int n = 0; n < NRanks; n++)
+            {
+                counts[n * kNBinsSIP + sIPBins[n]]++;
+            }
+        }
+        if (hasJetptSIP())
+        {
+            uint64_t *counts = &mJetptSIP[(size_t(f) * NRanks * kNBinsJetpt + kJetptAxis.bin(jetpt)) * kNBinsSIP];
+            for (int n = 0; n < NRanks; n++)
+            {
+                counts[size_t(n) * kNBinsJetpt * kNBinsSIP + sIPBins[n]]++;
+            }
+        }
+    }
+
+    /// Fills the histograms with nJets jets of flavor class f given as columns: jet pT and sIP of each rank.
+    /// The bins are computed for batches of jets, rank by rank, in loops without dependencies.
+    void fillColumns(int f, int64_t nJets, const float *jetpt, const float *const *signedIP2D)
+    {
+        constexpr int kBatch = 256;
+        int jetptBins[kBatch];
+        int sIPBins[kBatch];
+        mEntries[f] += nJets;
+        for (int64_t start = 0; start < nJets; start += kBatch)
+        {
+            const int nBatch = std::min<int64_t>(kBatch, nJets - start);
+            if (hasJetptSIP())
+            {
+                for (int i = 0; i < nBatch; i++)
+                {
+                    jetptBins[i] = kJetptAxis.bin(jetpt[start + i]);
+                }
+            }
+            for (int n = 0; n < NRanks; n++)
+            {
+                const float *sIP = signedIP2D[n] + start;
+                for (int i = 0; i < nBatch; i++)
+                {
+                    sIPBins[i] = kSIPAxis.bin(sIP[i]);
+                }
+                if (hasSIP())
+                {
+                    uint64_t *counts = &mSIP[(size_t(f) * NRanks + n) * kNBinsSIP];
+                    for (int i = 0; i < nBatch; i++)
+                    {
+                        counts[sIPBins[i]]++;
+                    }
+                }
+                if (hasJetptSIP())
+                {
+                    uint64_t *counts = &mJetptSIP[(size_t(f) * NRanks + n) * kNBinsJetpt * kNBinsSIP];
+                    for (int i = 0; i < nBatch; i++)
+                    {
+                        counts[jetptBins[i] * kNBinsSIP + sIPBins[i]]++;
+                    }
+                }
+            }
+        }
+    }
+
+    /// Adds the counts of another bank (filled by another thread)
+    void add(const TrackCountingBankT &other)
+    {
+        for (size_t i = 0; i < mSIP.size(); i++)
+        {
+            mSIP[i] += other.mSIP[i];
+        }
+        for (size_t i = 0; i < mJetptSIP.size(); i++)
+        {
+            mJetptSIP[i] += other.mJetptSIP[i];
+        }
+        for (int f = 0; f < NFlavors; f++)
+        {
+            mEntries[f] += other.mEntries[f];
+        }
+    }
+
+    uint64_t entries(int f) const { return mEntries[f]; }
+    uint64_t sIPCount(int f, int n, int y) const { return mSIP[(size_t(f) * NRanks + n) * kNBinsSIP + y]; }
+    uint64_t jetptSIPCount(int f, int n, int x, int y) const { return mJetptSIP[((size_t(f) * NRanks + n) * kNBinsJetpt + x) * kNBinsSIP + y]; }
+
+  private:
+    std::vector<uint64_t> mSIP;
+    std::vector<uint64_t> mJetptSIP;
+    uint64_t mEntries[NFlavors] = {};
+};
+using TrackCountingBank = TrackCountingBankT<kNFlavors, kNRanks>;
+
+/// Adds the counts of a bank to the booked histograms (unit weights: the sum of squared weights is the count).
+/// SetBinContent increments the number of entries of the histogram at each call, so it is restored afterwards.
+inline void addTrackCountingBank(TrackCountingHistos &histos, const TrackCountingBank &bank)
+{
+    for (int f = 0; f < kNFlavors; f++)
+    {
+        for (int n = 0; n < kNRanks; n++)
+        {
+            if (histos.sIP[f][n] and bank.hasSIP())
+            {
+                TH1F *h = histos.sIP[f][n];
+                const double entries = h->GetEntries();
+                for (int y = 0; y < TrackCountingBank::kNBinsSIP; y++)
+                {
+                    const uint64_t count = bank.sIPCount(f, n, y);
+                    h->SetBinContent(y, h->GetBinContent(y) + count);
+                    if (h->GetSumw2N())
+                    {
+                        h->GetSumw2()->fArray[y] += count;
+                    }
+                }
+                h->SetEntries(entries + bank.entries(f));
+            }
+            if (histos.jetpt_sIP[f][n] and bank.hasJetptSIP())
+            {
+                TH2D *h = histos.jetpt_sIP[f][n];
+                const double entries = h->GetEntries();
+                for (int x = 0; x < TrackCountingBank::kNBinsJetpt; x++)
+                {
+                    for (int y = 0; y < TrackCountingBank::kNBinsSIP; y++)
+                    {
+                        const int bin = h->GetBin(x, y);
+                        const uint64_t count = bank.jetptSIPCount(f, n, x, y);
+                        h->SetBinContent(bin, h->GetBinContent(bin) + count);
+                        if (h->GetSumw2N())
+                        {
+                            h->GetSumw2()->fArray[bin] += count;
+                        }
+                    }
+                }
+                h->SetEntries(entries + bank.entries(f));
+            }
+        }
+    }
+}
+
+/// Recomputes the statistics (mean, RMS) of the histograms from the bin contents, keeping the number of entries
+inline void finalizeTrackCountingHistos(TrackCountingHistos &histos)
+{
+    for (int f = 0; f < kNFlavors; f++)
+    {
+        for (int n = 0; n < kNRanks; n++)
+        {
+            TH1 *hists[2] = {histos.sIP[f][n], histos.jetpt_sIP[f][n]};
+            for (TH1 *h : hists)
+            {
+                if (h)
+                {
+                    const double entries = h->GetEntries();
+                    h->ResetStats();
+                    h->SetEntries(entries);
+                }
+            }
+        }
+    }
+}
+
+/// Splits the entries [0, nEntries) of the tree in nChunks contiguous ranges [first, last) aligned on the clusters of the tree
+inline std::vector<std::pair<Long64_t, Long64_t>> trackCountingClusterRanges(TTree *mytree, Long64_t nEntries, int nChunks)
+{
+    std::vector<Long64_t> clusterStarts;
+    TTree::TClusterIterator clusterIter = mytree->GetClusterIterator(0);
+    Long64_t start;
+    while ((start = clusterIter()) < nEntries)
+    {
+        clusterStarts.push_back(start);
+    }
+
+    std::vector<std::pair<Long64_t, Long64_t>> ranges;
+    Long64_t first = 0;
+    size_t iCluster = 0;
+    for (int k = 1; k <= nChunks and first < nEntries; k++)
+    {
+        // first cluster starting after the k-th fraction of the entries
+        const Long64_t target = nEntries * k / nChunks;
+        while (iCluster < clusterStarts.size() and clusterStarts[iCluster] < target)
+        {
+            iCluster++;
+        }
+        const Long64_t last = (k == nChunks or iCluster == clusterStarts.size()) ? nEntries : clusterStarts[iCluster];
+        if (last > first)
+        {
+            ranges.emplace_back(first, last);
+            first = last;
+        }
+    }
+    return ranges;
+}
+
+/// Branches of a jet read from the tree
+struct TrackCountingJet
+{
+    int flavor;
+    float jetpt = 0;
+    float signedIP2D[kMaxTracks];
+};
+
+/// Reads only the branches used by the tagger (mJetpT only if withJetpt) into jet, through a TTreeCache
+/// prefetching the baskets of these branches in the entries [first, last)
+inline void attachTrackCountingBranches(TTree *mytree, TrackCountingJet &jet, bool withJetpt, Long64_t first, Long64_t last)
+{
+    mytree->SetBranchStatus("*", false);
+    mytree->SetBranchStatus("mJetFlavor", true);
+    mytree->SetBranchStatus("mSignedIP2D", true);
+    mytree->SetBranchAddress("mJetFlavor", &jet.flavor);
+    mytree->SetBranchAddress("mSignedIP2D", jet.signedIP2D);
+    if (withJetpt)
+    {
+        mytree->SetBranchStatus("mJetpT", true);
+        mytree->SetBranchAddress("mJetpT", &jet.jetpt);
+    }
+
+    mytree->SetCacheSize(kTreeCacheSize);
+    mytree->SetCacheEntryRange(first, last);
+    mytree->AddBranchToCache("mJetFlavor", true);
+    mytree->AddBranchToCache("mSignedIP2D", true);
+    if (withJetpt)
+    {
+        mytree->AddBranchToCache("mJetpT", true);
+    }
+    mytree->StopCacheLearningPhase();
+}
+
+/// Calls fillJet(entry, f, jet) for each jet of a used flavor class f in the entries [first, last) of the tree (jet pT read only if withJetpt)
+template <typename FillJet>
+void forEachTrackCountingJet(TTree *mytree, bool withJetpt, Long64_t first, Long64_t last, FillJet fillJet)
+{
+    TrackCountingJet jet;
+    attachTrackCountingBranches(mytree, jet, withJetpt, first, last);
+
+    for (Long64_t i = first; i < last; i++)
+    {
+        mytree->GetEntry(i);
+
+        const int f = trackCountingFlavorClass(jet.flavor);
+        if (f >= 0)
+        {
+            fillJet(i, f, jet);
+        }
+    }
+}
+
+/// Fills the bank with the entries [first, last) of the tree
+inline void fillTrackCountingBank(TTree *mytree, TrackCountingBank &bank, Long64_t first, Long64_t last)
+{
+    forEachTrackCountingJet(mytree, bank.hasJetptSIP(), first, last, [&bank](Long64_t, int f, const TrackCountingJet &jet) { bank.fill(f, jet.jetpt, jet.signedIP2D); });
+}
+
+/// Number of threads to use: nThreads, or all the cores if nThreads <= 0
+inline int trackCountingThreads(int nThreads)
+{
+    return nThreads > 0 ? nThreads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+/// Fills a bank with nTasks independent tasks run on nThreads threads (0 = all the cores).
+/// Each thread fills its own empty copy of the bank with fillTask(k, copy) for the tasks it runs, and the copies
+/// are added to the bank at the end. The counts being integers, the result does not depend on which thread ran
+/// which task: it is identical to the one of the serial run.
+template <typename Bank, typename Task>
+void runTrackCountingTasks(Bank &bank, unsigned nTasks, int nThreads, Task fillTask)
+{
+    nThreads = trackCountingThreads(nThreads);
+    if (nThreads == 1 or nTasks == 1)
+    {
+        for (unsigned k = 0; k < nTasks; k++)
+        {
+            fillTask(k, bank);
+        }
+        return;
+    }
+
+    // one copy per thread, taken by a task from the free copies and given back at its end
+    const unsigned nCopies = std::min<unsigned>(nThreads, nTasks);
+    std::vector<Bank> copies;
+    std::vector<Bank *> freeCopies;
+    for (unsigned k = 0; k < nCopies; k++)
+    {
+        copies.push_back(bank.emptyCopy());
+    }
+    for (auto &copy : copies)
+    {
+        freeCopies.push_back(&copy);
+    }
+    std::mutex copiesMutex;
+    std::condition_variable copyFreed;
+
+    ROOT::EnableThreadSafety();
+    ROOT::TThreadExecutor pool(nThreads);
+    pool.Foreach([&](unsigned k) {
+        Bank *copy;
+        {
+            std::unique_lock<std::mutex> lock(copiesMutex);
+            copyFreed.wait(lock, [&] { return !freeCopies.empty(); });
+            copy = freeCopies.back();
+            freeCopies.pop_back();
+        }
+        fillTask(k, *copy);
+        {
+            std::lock_guard<std::mutex> lock(copiesMutex);
+            freeCopies.push_back(copy);
+        }
+        copyFreed.notify_one();
+    },
+                 ROOT::TSeqU(nTasks));
+
+    for (const auto &copy : copies)
+    {
+        bank.add(copy);
+    }
+}
+
+/// Opens the tree of a file, printing an error if it cannot be found
+inline TTree *openTrackCountingTree(const char *fileName, const char *treeName, std::unique_ptr<TFile> &myFile)
+{
+    myFile.reset(TFile::Open(fileName));
+    if (!myFile or myFile->IsZombie())
+    {
+        printf("openTrackCountingTree: cannot open %s\n", fileName);
+        return nullptr;
+    }
+    TTree *mytree = myFile->Get<TTree>(treeName);
+    if (!mytree)
+    {
+        printf("openTrackCountingTree: no tree %s in %s\n", treeName, fileName);
+    }
+    return mytree;
+}
+
+#endif // TRACKCOUNTINGCORE_H_
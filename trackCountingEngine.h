@@ -0,0 +1,240 @@
+// Copyright 2019-2020 CERN and copyright holders of ALICE O2.
+// See https://alice-o2.web.cern.ch/copyright for details of the copyright holders.
+// All rights not expressly granted are reserved.
+//
+// This software is distributed under the terms of the GNU General Public
+// License v3 (GPL Version 3), copied verbatim in the file "COPYING".
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+/// \file trackCountingEngine.h
+/// \brief Analysis engine filling all the histograms of the track counting macros (sIP distributions, jet pT vs. sIP) in a single pass over one or several outputs of bjetTreeMerger.cxx
+///
+/// \author Clement Lotteau <clement.lotteau@cern.ch> IP2I
+
+#ifndef TRACKCOUNTINGENGINE_H_
+#define TRACKCOUNTINGENGINE_H_
+
+#include "trackCountingCore.h"
+#include "trackCountingSkim.h"
+
+#include <TChain.h>
+#include <TStopwatch.h>
+
+#include <atomic>
+#include <fstream>
+#include <string>
+
+constexpr const char *kTrackCountingTree = "bjet-tree-merger/myTree"; // default tree read by the macros
+
+/// Input files of a pass: a file, a pattern with wildcards in the file name (e.g. "merged/period_*.root"),
+/// or a text file (.txt or .list) listing one file or pattern per line. The patterns are expanded by TChain.
+inline std::vector<std::string> expandTrackCountingInput(const char *input, const char *treeName)
+{
+    std::vector<std::string> patterns;
+    const TString inputName(input);
+    if (inputName.EndsWith(".txt") or inputName.EndsWith(".list"))
+    {
+        std::ifstream list(input);
+        if (!list)
+        {
+            printf("expandTrackCountingInput: cannot open the file list %s\n", input);
+        }
+        std::string line;
+        while (std::getline(list, line))
+        {
+            line.erase(0, line.find_first_not_of(" \t"));
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (!line.empty() and line[0] != '#')
+            {
+                patterns.push_back(line);
+            }
+        }
+    }
+    else
+    {
+        patterns.push_back(input);
+    }
+
+    TChain chain(treeName);
+    for (const auto &pattern : patterns)
+    {
+        chain.Add(pattern.c_str());
+    }
+    std::vector<std::string> fileNames;
+    for (TObject *element : *chain.GetListOfFiles())
+    {
+        fileNames.push_back(element->GetTitle());
+    }
+    return fileNames;
+}
+
+/// Maps the skim of the tree treeName of a file, building it first on nThreads threads (0 = all the cores) if it is missing or out of date.
+/// Returns false if no skim can be used.
+inline bool openTrackCountingSkim(const char *fileName, const char *treeName, TrackCountingSkim &skim, int nThreads = 1)
+{
+    const std::string skimName = trackCountingSkimName(fileName);
+    return skim.open(skimName.c_str(), fileName, treeName) or
+           (buildTrackCountingSkim(fileName, treeName, skimName.c_str(), nThreads) and skim.open(skimName.c_str(), fileName, treeName));
+}
+
+/// Fills the bank with the chunk-th of nChunks groups of blocks of a skim.
+/// Returns the number of entries of the tree for the first chunk (0 for the others).
+inline Long64_t fillTrackCountingChunkFromSkim(const TrackCountingSkim &skim, TrackCountingBank &bank, int chunk, int nChunks)
+{
+    const int64_t nBlocks = skim.nBlocks();
+    fillTrackCountingBankFromSkim(skim, bank, nBlocks * chunk / nChunks, nBlocks * (chunk + 1) / nChunks);
+    return chunk == 0 ? skim.header().nEntries : 0;
+}
+
+/// Calls fillRange(mytree, first, last) for the chunk-th of nChunks cluster-aligned ranges of entries [first, last) of the tree of a file.
+/// Returns the number of entries of the tree for the first chunk (0 for the others), -1 if the tree could not be opened.
+template <typename FillRange>
+Long64_t readTrackCountingChunkFromTree(const char *fileName, const char *treeName, int chunk, int nChunks, FillRange fillRange)
+{
+    std::unique_ptr<TFile> myFile;
+    TTree *mytree = openTrackCountingTree(fileName, treeName, myFile);
+    if (!mytree)
+    {
+        return -1;
+    }
+    const Long64_t nEntries = mytree->GetEntries();
+    const auto ranges = trackCountingClusterRanges(mytree, nEntries, nChunks);
+    if (chunk < (int)ranges.size())
+    {
+        fillRange(mytree, ranges[chunk].first, ranges[chunk].second);
+    }
+    return chunk == 0 ? nEntries : 0;
+}
+
+/// Number of chunks in which each of nFiles files is split so that there is at least one task per thread
+inline int trackCountingChunksPerFile(int nFiles, int nThreads)
+{
+    return (trackCountingThreads(nThreads) + nFiles - 1) / nFiles;
+}
+
+/// Fills a bank with one read of the files fileNames on nThreads threads (0 = all the cores): the files are processed
+/// concurrently, each one split in trackCountingChunksPerFile chunks, and each task runs fillChunk(fileIndex, chunk, nChunks, copy)
+/// with the copy of the bank of its thread (see runTrackCountingTasks). fillChunk returns the number of entries of the file for
+/// its first chunk (0 for the others), -1 if the file could not be read. The files which could not be read and the throughput
+/// are reported with the name of caller. Returns the number of entries read, -1 if no file could be read.
+template <typename Bank, typename FillChunk>
+Long64_t runTrackCountingFileTasks(const char *caller, const std::vector<std::string> &fileNames, Bank &bank, int nThreads, FillChunk fillChunk)
+{
+    TStopwatch timer;
+    const int nFiles = fileNames.size();
+    if (nFiles == 0)
+    {
+        return -1;
+    }
+    nThreads = trackCountingThreads(nThreads);
+    const int nChunks = trackCountingChunksPerFile(nFiles, nThreads);
+
+    std::atomic<Long64_t> nEntries(0);
+    std::atomic<int> nFailed(0);
+    runTrackCountingTasks(bank, nFiles * nChunks, nThreads, [&](unsigned k, Bank &copy) {
+        const int chunk = k % nChunks;
+        const Long64_t n = fillChunk(k / nChunks, chunk, nChunks, copy);
+        if (n >= 0)
+        {
+            nEntries += n;
+        }
+        else if (chunk == 0)
+        {
+            nFailed++;
+        }
+    });
+
+    timer.Stop();
+    if (nFailed > 0)
+    {
+        printf("%s: WARNING %d of the %d input files could not be read\n", caller, nFailed.load(), nFiles);
+    }
+    printf("%s: %lld entries read from %d file(s) with %d thread(s) in %.1f s (%.3g jets/s)\n", caller, nEntries.load(), nFiles, nThreads, timer.RealTime(), nEntries / timer.RealTime());
+    return nFailed == nFiles ? -1 : nEntries.load();
+}
+
+/// Fills a bank with one read of the input files (see expandTrackCountingInput), outputs of bjetTreeMerger.cxx.
+/// The files are processed concurrently on nThreads threads (0 = all the cores); when there are fewer files than
+/// threads, each file is split in several chunks (cluster-aligned ranges of entries), see runTrackCountingFileTasks.
+/// Each thread fills its own copy of the bank and the copies are added at the end: the result is identical to the one
+/// of the serial pass.
+/// With useSkim, the jets are read from the skim of each file (see trackCountingSkim.h), which is built with
+/// this read of the tree if it is missing or out of date; the tree is read directly if the skim cannot be used. The source
+/// of a file is chosen once for all its chunks, so that they split the same entries.
+/// Returns the number of entries read, -1 if no file could be read.
+inline Long64_t runTrackCountingBankPass(const char *input, TrackCountingBank &bank, int nThreads = 1, const char *treeName = kTrackCountingTree, bool useSkim = true)
+{
+    const std::vector<std::string> fileNames = expandTrackCountingInput(input, treeName);
+    if (fileNames.empty())
+    {
+        printf("runTrackCountingBankPass: no input file for %s\n", input);
+        return -1;
+    }
+    const int nFiles = fileNames.size();
+    const int nChunksPerFile = trackCountingChunksPerFile(nFiles, nThreads);
+
+    // the source of each file (skim or tree) is chosen once, so that all the chunks of a file split it in the same way.
+    // With fewer files than threads, the skims are mapped beforehand (the missing ones built with all the threads), and stay
+    // mapped during the pass even if they are replaced; otherwise each file is read by a single task, which maps its own skim.
+    std::vector<std::unique_ptr<TrackCountingSkim>> skims(nFiles);
+    if (useSkim and nChunksPerFile > 1)
+    {
+        for (int i = 0; i < nFiles; i++)
+        {
+            std::unique_ptr<TrackCountingSkim> skim(new TrackCountingSkim);
+            if (openTrackCountingSkim(fileNames[i].c_str(), treeName, *skim, nThreads))
+            {
+                skims[i] = std::move(skim);
+            }
+        }
+    }
+
+    std::atomic<Long64_t> nEntriesFromSkim(0);
+    const Long64_t nEntries = runTrackCountingFileTasks("runTrackCountingBankPass", fileNames, bank, nThreads, [&](int fileIndex, int chunk, int nChunks, TrackCountingBank &copy) {
+        const char *fileName = fileNames[fileIndex].c_str();
+        Long64_t n = -1;
+        if (skims[fileIndex])
+        {
+            n = fillTrackCountingChunkFromSkim(*skims[fileIndex], copy, chunk, nChunks);
+        }
+        else if (useSkim and nChunks == 1)
+        {
+            TrackCountingSkim skim;
+            if (openTrackCountingSkim(fileName, treeName, skim))
+            {
+                n = fillTrackCountingChunkFromSkim(skim, copy, 0, 1);
+            }
+        }
+        if (n >= 0)
+        {
+            nEntriesFromSkim += n;
+            return n;
+        }
+        return readTrackCountingChunkFromTree(fileName, treeName, chunk, nChunks,
+                                              [&copy](TTree *mytree, Long64_t first, Long64_t last) { fillTrackCountingBank(mytree, copy, first, last); });
+    });
+    if (useSkim)
+    {
+        printf("runTrackCountingBankPass: %lld entries read from skims\n", nEntriesFromSkim.load());
+    }
+    return nEntries;
+}
+
+/// Fills all the booked histograms (all the ranks) with one read of the input files, see runTrackCountingBankPass.
+/// Returns the number of entries read, -1 if no file could be read.
+inline Long64_t runTrackCountingPass(const char *input, TrackCountingHistos &histos, int nThreads = 1, const char *treeName = kTrackCountingTree, bool useSkim = true)
+{
+    TrackCountingBank bank(histos.hasSIP(), histos.hasJetptSIP());
+    const Long64_t nEntries = runTrackCountingBankPass(input, bank, nThreads, treeName, useSkim);
+    if (nEntries >= 0)
+    {
+        addTrackCountingBank(histos, bank);
+        finalizeTrackCountingHistos(histos);
+    }
+    return nEntries;
+}
+
+#endif // TRACKCOUNTINGENGINE_H_
@@ -0,0 +1,202 @@
+// Copyright 2019-2020 CERN and copyright holders of ALICE O2.
+// See https://alice-o2.web.cern.ch/copyright for details of the copyright holders.
+// All rights not expressly granted are reserved.
+//
+// This software is distributed under the terms of the GNU General Public
+// License v3 (GPL Version 3), copied verbatim in the file "COPYING".
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+/// \file trackCountingPlots.h
+/// \brief Plots of the track counting macros (sIP distributions, efficiency and mistagging rates vs. jet pT, ROC curves) drawn on a given pad, and results file holding the histograms filled by trackCountingEngine.h, so that the plots can be produced without reading the tree
+///
+/// \author Clement Lotteau <clement.lotteau@cern.ch> IP2I
+
+#ifndef TRACKCOUNTINGPLOTS_H_
+#define TRACKCOUNTINGPLOTS_H_
+
+#include "trackCountingScan.h"
+
+#include <TLegend.h>
+#include <TVirtualPad.h>
+
+#include <functional>
+
+/// Common style of the graphs in the plots (same as the histograms)
+inline void setTrackCountingStyle(TGraph *g, int color)
+{
+    g->SetMarkerStyle(20);
+    g->SetMarkerSize(0.5);
+    g->SetMarkerColor(color);
+    g->SetLineColor(color);
+    g->SetLineWidth(2);
+}
+
+/// Draws the histograms of the three flavor classes on the current pad with the common style of the plots: b first, with the
+/// titles of the plot and of the axes, then c and lf, and their legend in the box (x1, y1, x2, y2), returned to add entries
+inline TLegend *drawTrackCountingFlavors(TH1 *const hists[kNFlavors], const char *const labels[kNFlavors], const char *title, const char *xTitle, const char *yTitle,
+                                     double x1, double y1, double x2, double y2, double textSize)
+{
+    // settings for plots
+    for (int f = 0; f < kNFlavors; f++)
+    {
+        setTrackCountingStyle(hists[f], kFlavorColors[f]);
+    }
+    // drawing histograms
+    hists[kB]->Draw();
+    hists[kC]->Draw("SAME");
+    hists[kLf]->Draw("SAME");
+    // set title for plot, x and y axis
+    hists[kB]->SetTitle(title);
+    hists[kB]->GetXaxis()->SetTitle(xTitle);
+    hists[kB]->GetYaxis()->SetTitle(yTitle);
+    // set legend
+    TLegend *legend = new TLegend(x1, y1, x2, y2);
+    legend->AddEntry(hists[kB], labels[kB]);
+    legend->AddEntry(hists[kC], labels[kC]);
+    legend->AddEntry(hists[kLf], labels[kLf]);
+    legend->SetBorderSize(0);
+    legend->SetTextSize(textSize);
+    legend->Draw("AP");
+    return legend;
+}
+
+/// Draws the normalized sIP distributions of the (n+1)-th largest IP on pad (plot of sIP_distrib_N123.C)
+inline void drawTrackCountingSIP(TVirtualPad *pad, const TrackCountingHistos &histos, int n)
+{
+    constexpr const char *kLabels[kNFlavors] = {"lf", "c", "b"};
+    pad->cd();
+    pad->SetLogy();
+    TH1 *hists[kNFlavors] = {histos.sIP[kLf][n], histos.sIP[kC][n], histos.sIP[kB][n]};
+    drawTrackCountingFlavors(hists, kLabels, Form("sIP distribution for b-jet tagger - %s", trackCountingRankTitle(n)), "2D signed impact parameter (sIP) (cm)", "Normalized counts",
+                             0.2, 0.55, 0.4, 0.7, 0.045);
+}
+
+constexpr const char *kRateLabels[kNFlavors] = {"Mistagging lf", "Mistagging c", "Efficiency"}; // legend of the rates
+
+/// Draws the efficiency and mistagging rates vs. jet pT of the (n+1)-th largest IP on pad (plot of sIP_eff_mistag_jet_pT_N123.C)
+inline void drawTrackCountingRates(TVirtualPad *pad, const TrackCountingRates &rates, int n)
+{
+    pad->cd();
+    pad->SetLogy(0);
+    TH1 *hists[kNFlavors] = {rates.rate[kLf][n], rates.rate[kC][n], rates.rate[kB][n]};
+    drawTrackCountingFlavors(hists, kRateLabels, Form("Efficiency and mistagging rates of sIP b-jet tagger - %s", trackCountingRankTitle(n)), "jet pT (GeV/c)", "Efficiency and mistagging rates",
+                             0.13, 0.85, 0.3, 0.75, 0.03);
+    // set limits on plot
+    hists[kB]->SetMinimum(0);
+    hists[kB]->SetMaximum(1);
+}
+
+/// Draws the ROC curves (b-jet efficiency vs. c and lf mistagging rates) of the (n+1)-th largest IP on pad (plot of sIP_wp_scan_N123.C)
+inline void drawTrackCountingROC(TVirtualPad *pad, const TrackCountingROCs &rocs, int n)
+{
+    TGraph *roc_c = rocs.roc[kC][n];
+    TGraph *roc_lf = rocs.roc[kLf][n];
+    pad->cd();
+    pad->SetLogy();
+    // settings for plots
+    setTrackCountingStyle(roc_c, kFlavorColors[kC]);
+    setTrackCountingStyle(roc_lf, kFlavorColors[kLf]);
+    // drawing graphs
+    roc_c->Draw("ALP");
+    roc_lf->Draw("LP");
+    // set title for plot, x and y axis
+    roc_c->SetTitle(Form("ROC curves of sIP b-jet tagger - %s", trackCountingRankTitle(n)));
+    roc_c->GetXaxis()->SetTitle("Efficiency");
+    roc_c->GetYaxis()->SetTitle("Mistagging rate");
+    roc_c->SetMinimum(1e-5);
+    roc_c->SetMaximum(1);
+    // set legend
+    TLegend *legend = new TLegend(0.13, 0.85, 0.3, 0.75);
+    legend->AddEntry(roc_c, "Mistagging c");
+    legend->AddEntry(roc_lf, "Mistagging lf");
+    legend->SetBorderSize(0);
+    legend->SetTextSize(0.03);
+    legend->Draw();
+}
+
+/// A plot: name (of its canvas and pdf file) and function drawing it on a pad
+struct TrackCountingPage
+{
+    std::string name;
+    std::function<void(TVirtualPad *)> draw;
+};
+
+/// Plots of sIP_distrib_N123.C, sIP_eff_mistag_jet_pT_N123.C and ROC curves of sIP_wp_scan_N123.C for the nRanks largest IP,
+/// from normalized sIP distributions, rates and ROC curves
+inline std::vector<TrackCountingPage> trackCountingPages(const TrackCountingHistos &histos, const TrackCountingRates &rates, const TrackCountingROCs &rocs, int nRanks)
+{
+    std::vector<TrackCountingPage> pages;
+    for (int n = 0; n < nRanks; n++)
+    {
+        pages.push_back({Form("sIP_distrib_N%d", n + 1), [&histos, n](TVirtualPad *pad) { drawTrackCountingSIP(pad, histos, n); }});
+    }
+    for (int n = 0; n < nRanks; n++)
+    {
+        pages.push_back({Form("sIP_eff_mistag_jet_pT_N%d", n + 1), [&rates, n](TVirtualPad *pad) { drawTrackCountingRates(pad, rates, n); }});
+    }
+    for (int n = 0; n < nRanks; n++)
+    {
+        pages.push_back({Form("sIP_roc_N%d", n + 1), [&rocs, n](TVirtualPad *pad) { drawTrackCountingROC(pad, rocs, n); }});
+    }
+    return pages;
+}
+
+/// Writes the booked histograms (raw counts, all the ranks) to the results file outputName
+inline bool writeTrackCountingResults(const char *outputName, const TrackCountingHistos &histos)
+{
+    std::unique_ptr<TFile> outputFile(TFile::Open(outputName, "RECREATE"));
+    if (!outputFile or outputFile->IsZombie())
+    {
+        printf("writeTrackCountingResults: cannot create %s\n", outputName);
+        return false;
+    }
+    bool ok = true;
+    for (int f = 0; f < kNFlavors; f++)
+    {
+        for (int n = 0; n < kNRanks; n++)
+        {
+            ok = ok and (!histos.sIP[f][n] or outputFile->WriteTObject(histos.sIP[f][n]) > 0);
+            ok = ok and (!histos.jetpt_sIP[f][n] or outputFile->WriteTObject(histos.jetpt_sIP[f][n]) > 0);
+        }
+    }
+    outputFile->Close();
+    if (!ok)
+    {
+        printf("writeTrackCountingResults: cannot write %s\n", outputName);
+    }
+    return ok;
+}
+
+/// Adds the histograms of a results file (or of a state file of trackCountingAccumulator.h) to the booked histograms.
+/// Returns false if the file cannot be read or a booked histogram is missing.
+inline bool readTrackCountingResults(const char *inputName, TrackCountingHistos &histos)
+{
+    std::unique_ptr<TFile> inputFile(TFile::Open(inputName));
+    if (!inputFile or inputFile->IsZombie())
+    {
+        printf("readTrackCountingResults: cannot open %s\n", inputName);
+        return false;
+    }
+    for (int f = 0; f < kNFlavors; f++)
+    {
+        for (int n = 0; n < kNRanks; n++)
+        {
+            TH1 *hists[2] = {histos.sIP[f][n], histos.jetpt_sIP[f][n]};
+            for (TH1 *h : hists)
+            {
+                TH1 *stored = h ? inputFile->Get<TH1>(h->GetName()) : nullptr;
+                if (h and (!stored or !h->Add(stored)))
+                {
+                    printf("readTrackCountingResults: missing or incompatible histogram %s in %s\n", h->GetName(), inputName);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+#endif // TRACKCOUNTINGPLOTS_H_
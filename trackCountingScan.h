@@ -0,0 +1,175 @@
+// Copyright 2019-2020 CERN and copyright holders of ALICE O2.
+// See https://alice-o2.web.cern.ch/copyright for details of the copyright holders.
+// All rights not expressly granted are reserved.
+//
+// This software is distributed under the terms of the GNU General Public
+// License v3 (GPL Version 3), copied verbatim in the file "COPYING".
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+/// \file trackCountingScan.h
+/// \brief Working point scan of the track counting tagger: efficiency and mistagging rates vs. jet pT for many sIP thresholds, and ROC curves, from the jet pT vs. sIP histograms filled by trackCountingEngine.h
+///
+/// \author Clement Lotteau <clement.lotteau@cern.ch> IP2I
+
+#ifndef TRACKCOUNTINGSCAN_H_
+#define TRACKCOUNTINGSCAN_H_
+
+#include "trackCountingEngine.h"
+
+#include <TGraph.h>
+#include <TH1D.h>
+#include <TString.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// Name of the rate computed for a flavor class: efficiency for b jets, mistagging rates for c and lf jets
+inline const char *trackCountingRateName(int f)
+{
+    return f == kB ? "efficiency" : (f == kC ? "mistagging_c" : "mistagging_lf");
+}
+
+/// Efficiency (b) and mistagging rates (c, lf) vs. jet pT, indexed by [flavor class][rank]
+struct TrackCountingRates
+{
+    TH1D *rate[kNFlavors][kNRanks] = {};
+};
+
+/// Cumulative sums along the sIP axis of a jet pT vs. sIP histogram: for each jet pT bin x and sIP bin y,
+/// number of jets (and sum of squared weights) with a sIP in the bins [y, overflow].
+/// The numerator of the rates for a threshold sIPmin is then read in the bin of sIPmin, and the denominator in the
+/// underflow bin, instead of projecting the histogram for each threshold.
+struct TrackCountingCumulative
+{
+    const TH2D *hist = nullptr;
+    int nx = 0, ny = 0;
+    std::vector<double> sumw, sumw2; // [x * (ny + 2) + y], under- and overflow bins included
+    std::unique_ptr<TH1D> empty;      // empty jet pT histogram, with the binning of the jet pT axis
+
+    explicit TrackCountingCumulative(const TH2D *h) : hist(h), nx(h->GetNbinsX()), ny(h->GetNbinsY()), sumw((nx + 2) * (ny + 2)), sumw2((nx + 2) * (ny + 2))
+    {
+        empty.reset(h->ProjectionX(Form("%s_empty_px", h->GetName()), 1, 1));
+        empty->SetDirectory(nullptr);
+        empty->Reset();
+        if (empty->GetSumw2N() == 0)
+        {
+            empty->Sumw2();
+        }
+        const TArrayD *errors = h->GetSumw2();
+        for (int x = 0; x <= nx + 1; x++)
+        {
+            double w = 0, w2 = 0;
+            for (int y = ny + 1; y >= 0; y--)
+            {
+                const int bin = h->GetBin(x, y);
+                const double content = h->GetBinContent(bin);
+                w += content;
+                w2 += errors->fN ? errors->fArray[bin] : content;
+                sumw[x * (ny + 2) + y] = w;
+                sumw2[x * (ny + 2) + y] = w2;
+            }
+        }
+    }
+
+    double w(int x, int y) const { return sumw[x * (ny + 2) + y]; }
+    double w2(int x, int y) const { return sumw2[x * (ny + 2) + y]; }
+
+    /// Jet pT distribution of the jets with a sIP in the bins [y, overflow] (same as ProjectionX(name, y, -1))
+    TH1D *projection(const char *name, int y) const
+    {
+        TH1D *proj = (TH1D *)empty->Clone(name);
+        for (int x = 0; x <= nx + 1; x++)
+        {
+            proj->SetBinContent(x, w(x, y));
+            proj->GetSumw2()->fArray[x] = w2(x, y);
+        }
+        return proj;
+    }
+};
+
+/// Efficiency (b jets) or mistagging rate (c, lf jets) vs. jet pT for the threshold sIPmin, with binomial errors
+inline TH1D *trackCountingRate(const TrackCountingCumulative &cumulative, double sIPmin, const char *name)
+{
+    const int y = cumulative.hist->GetYaxis()->FindFixBin(sIPmin);
+    std::unique_ptr<TH1D> projected(cumulative.projection(Form("%s_projected", name), y));
+    std::unique_ptr<TH1D> projected_full(cumulative.projection(Form("%s_projected_full", name), 0));
+    TH1D *rate = (TH1D *)projected->Clone(name);
+    rate->Reset();
+    rate->Divide(projected.get(), projected_full.get(), 1, 1, "B");
+    return rate;
+}
+
+/// ROC curve (b-jet efficiency vs. c or lf mistagging rate, integrated over the jet pT range) with one point per sIP bin edge
+inline TGraph *trackCountingROC(const TrackCountingCumulative &b, const TrackCountingCumulative &mistagged, const char *name)
+{
+    // jets in the jet pT range above each sIP bin
+    auto integrate = [](const TrackCountingCumulative &cumulative, int y) {
+        double w = 0;
+        for (int x = 1; x <= cumulative.nx; x++)
+        {
+            w += cumulative.w(x, y);
+        }
+        return w;
+    };
+    const double nB = integrate(b, 0);
+    const double nMistagged = integrate(mistagged, 0);
+
+    TGraph *roc = new TGraph(b.ny);
+    roc->SetName(name);
+    for (int y = 1; y <= b.ny; y++)
+    {
+        roc->SetPoint(y - 1, nB > 0 ? integrate(b, y) / nB : 0., nMistagged > 0 ? integrate(mistagged, y) / nMistagged : 0.);
+    }
+    return roc;
+}
+
+/// ROC curves of the c and lf jets (b-jet efficiency vs. mistagging rate), indexed by [flavor class][rank] (null for b)
+struct TrackCountingROCs
+{
+    TGraph *roc[kNFlavors][kNRanks] = {};
+};
+
+/// sIP thresholds from a list "0.004,0.008,0.012" or a range "min:max:n" of n thresholds (cm)
+inline std::vector<double> parseTrackCountingCuts(const char *cuts)
+{
+    std::vector<double> values;
+    std::string text(cuts);
+    if (text.find(':') != std::string::npos)
+    {
+        double low = 0, high = 0;
+        int n = 0;
+        if (sscanf(cuts, "%lf:%lf:%d", &low, &high, &n) != 3 or n < 1)
+        {
+            printf("parseTrackCountingCuts: invalid range %s (expected min:max:n)\n", cuts);
+            return values;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            values.push_back(n == 1 ? low : low + (high - low) * i / (n - 1));
+        }
+        return values;
+    }
+    size_t start = 0;
+    while (start < text.size())
+    {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos)
+        {
+            end = text.size();
+        }
+        if (end > start)
+        {
+            values.push_back(std::atof(text.substr(start, end - start).c_str()));
+        }
+        start = end + 1;
+    }
+    return values;
+}
+
+#endif // TRACKCOUNTINGSCAN_H_
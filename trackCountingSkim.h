@@ -0,0 +1,324 @@
+// Copyright 2019-2020 CERN and copyright holders of ALICE O2.
+// See https://alice-o2.web.cern.ch/copyright for details of the copyright holders.
+// All rights not expressly granted are reserved.
+//
+// This software is distributed under the terms of the GNU General Public
+// License v3 (GPL Version 3), copied verbatim in the file "COPYING".
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+/// \file trackCountingSkim.h
+/// \brief Skim cache of the outputs of bjetTreeMerger.cxx: columnar file of the jet pT and largest sIP of the jets, grouped by flavor class, read through mmap instead of decompressing the tree
+///
+/// \author Clement Lotteau <clement.lotteau@cern.ch> IP2I
+
+#ifndef TRACKCOUNTINGSKIM_H_
+#define TRACKCOUNTINGSKIM_H_
+
+#include "trackCountingCore.h"
+
+#include <TSystem.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+// The skim file is made of:
+//  - a header (TrackCountingSkimHeader), identifying the source file (size, modification time) and tree
+//  - blocks of kSkimBlockEntries entries of the tree, each holding for each flavor class the columns
+//    jet pT, sIP of the 1st largest IP, ..., sIP of the nRanks-th largest IP of the jets of this class
+//    (float arrays, each padded to kSkimAlignment bytes)
+//  - the index of the blocks (TrackCountingSkimBlock), in entry order
+constexpr char kSkimMagic[8] = {'T', 'C', 'S', 'K', 'I', 'M', '0', '1'};
+constexpr uint32_t kSkimVersion = 1;
+constexpr Long64_t kSkimBlockEntries = 1 << 20; // entries of the tree per block
+constexpr int64_t kSkimAlignment = 64;          // alignment of the blocks and columns (bytes)
+
+struct TrackCountingSkimHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t nRanks;     // number of sIP stored per jet
+    int64_t sourceSize;  // size of the source file when the skim was built
+    int64_t sourceMTime; // modification time of the source file when the skim was built
+    char treeName[128];
+    int64_t nEntries;    // entries of the source tree
+    int64_t nBlocks;
+    int64_t indexOffset; // offset of the block index
+};
+
+struct TrackCountingSkimBlock
+{
+    int64_t offset;            // offset of the block
+    int64_t nJets[kNFlavors];  // number of jets of each flavor class
+};
+
+/// Number of floats of a column of n jets, padded to the alignment
+inline int64_t trackCountingSkimPadded(int64_t n)
+{
+    const int64_t floatsPerLine = kSkimAlignment / sizeof(float);
+    return (n + floatsPerLine - 1) / floatsPerLine * floatsPerLine;
+}
+
+/// Name of the skim of a source file
+inline std::string trackCountingSkimName(const char *fileName)
+{
+    return std::string(fileName) + ".tcskim";
+}
+
+/// Read-only mapping of a skim file
+class TrackCountingSkim
+{
+  public:
+    TrackCountingSkim() = default;
+    TrackCountingSkim(const TrackCountingSkim &) = delete;
+    TrackCountingSkim &operator=(const TrackCountingSkim &) = delete;
+    ~TrackCountingSkim() { close(); }
+
+    /// Maps the skim of the tree treeName of fileName.
+    /// Returns false if the skim does not exist, is not complete or is out of date with respect to the source file.
+    bool open(const char *skimName, const char *fileName, const char *treeName)
+    {
+        close();
+        FileStat_t source;
+        if (gSystem->GetPathInfo(fileName, source) != 0)
+        {
+            return false;
+        }
+        const int fd = ::open(skimName, O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat skim;
+        if (fstat(fd, &skim) == 0 and skim.st_size >= (off_t)sizeof(TrackCountingSkimHeader))
+        {
+            mSize = skim.st_size;
+            void *data = mmap(nullptr, mSize, PROT_READ, MAP_SHARED, fd, 0);
+            mData = data == MAP_FAILED ? nullptr : (const char *)data;
+        }
+        ::close(fd);
+        if (!mData)
+        {
+            return false;
+        }
+
+        const TrackCountingSkimHeader &h = header();
+        const bool valid = memcmp(h.magic, kSkimMagic, sizeof(kSkimMagic)) == 0 and h.version == kSkimVersion and h.nRanks >= kNRanks and
+                           h.sourceSize == source.fSize and h.sourceMTime == source.fMtime and strncmp(h.treeName, treeName, sizeof(h.treeName)) == 0 and
+                           h.indexOffset + h.nBlocks * (int64_t)sizeof(TrackCountingSkimBlock) <= mSize;
+        if (!valid)
+        {
+            close();
+        }
+        return valid;
+    }
+
+    void close()
+    {
+        if (mData)
+        {
+            munmap((void *)mData, mSize);
+            mData = nullptr;
+        }
+    }
+
+    const TrackCountingSkimHeader &header() const { return *(const TrackCountingSkimHeader *)mData; }
+    int64_t nBlocks() const { return header().nBlocks; }
+    const TrackCountingSkimBlock &block(int64_t i) const { return ((const TrackCountingSkimBlock *)(mData + header().indexOffset))[i]; }
+
+    /// Column c of the jets of flavor class f in a block: c = 0 for the jet pT, c = 1 + n for the sIP of the (n+1)-th largest IP
+    const float *column(const TrackCountingSkimBlock &b, int f, int c) const
+    {
+        const int64_t nColumns = 1 + header().nRanks;
+        int64_t offset = 0;
+        for (int g = 0; g < f; g++)
+        {
+            offset += nColumns * trackCountingSkimPadded(b.nJets[g]);
+        }
+        offset += c * trackCountingSkimPadded(b.nJets[f]);
+        return (const float *)(mData + b.offset) + offset;
+    }
+
+  private:
+    const char *mData = nullptr;
+    int64_t mSize = 0;
+};
+
+/// Builds the skim of the tree treeName of a local file, reading the tree on nThreads threads (0 = all the cores).
+/// The skim is written to a temporary file with a unique name, renamed at the end, so that an interrupted build is never used
+/// and concurrent builds of the same skim each install a complete skim.
+/// Returns false if the skim could not be built (remote file, missing tree, write error).
+inline bool buildTrackCountingSkim(const char *fileName, const char *treeName, const char *skimName, int nThreads = 1)
+{
+    FileStat_t source;
+    if (gSystem->GetPathInfo(fileName, source) != 0 or strlen(treeName) >= sizeof(TrackCountingSkimHeader::treeName))
+    {
+        return false;
+    }
+    std::unique_ptr<TFile> myFile;
+    TTree *mytree = openTrackCountingTree(fileName, treeName, myFile);
+    if (!mytree)
+    {
+        return false;
+    }
+    const Long64_t nEntries = mytree->GetEntries();
+    nThreads = trackCountingThreads(nThreads);
+    const auto ranges = trackCountingClusterRanges(mytree, nEntries, nThreads);
+
+    // temporary file with a unique name, so that processes building the same skim concurrently do not write to the same file
+    std::string tmpName = std::string(skimName) + ".XXXXXX";
+    const int fd = mkstemp(&tmpName[0]);
+    FILE *out = fd < 0 ? nullptr : fdopen(fd, "wb");
+    if (!out)
+    {
+        printf("buildTrackCountingSkim: cannot create %s\n", tmpName.c_str());
+        if (fd >= 0)
+        {
+            ::close(fd);
+            remove(tmpName.c_str());
+        }
+        return false;
+    }
+    fchmod(fd, 0644); // mkstemp creates the file readable by its owner only
+    TrackCountingSkimHeader header{};
+    std::atomic<bool> ok(fwrite(&header, sizeof(header), 1, out) == 1);
+    int64_t end = (sizeof(header) + kSkimAlignment - 1) / kSkimAlignment * kSkimAlignment;
+    std::mutex outMutex;
+    std::vector<std::vector<TrackCountingSkimBlock>> blocks(ranges.size());
+
+    // each task reads a range of the tree and appends its blocks to the file
+    auto skimRange = [&](unsigned k) {
+        std::unique_ptr<TFile> workerFile;
+        TTree *workerTree = openTrackCountingTree(fileName, treeName, workerFile);
+        if (!workerTree)
+        {
+            ok = false;
+            return;
+        }
+        TrackCountingJet jet;
+        attachTrackCountingBranches(workerTree, jet, true, ranges[k].first, ranges[k].second);
+
+        std::vector<float> columns[kNFlavors][1 + kNRanks];
+        std::vector<float> buffer;
+        for (Long64_t start = ranges[k].first; start < ranges[k].second and ok; start += kSkimBlockEntries)
+        {
+            const Long64_t stop = std::min(start + kSkimBlockEntries, ranges[k].second);
+            for (auto &flavorColumns : columns)
+            {
+                for (auto &column : flavorColumns)
+                {
+                    column.clear();
+                }
+            }
+            for (Long64_t i = start; i < stop; i++)
+            {
+                workerTree->GetEntry(i);
+                const int f = trackCountingFlavorClass(jet.flavor);
+                if (f < 0)
+                {
+                    continue;
+                }
+                columns[f][0].push_back(jet.jetpt);
+                for (int n = 0; n < kNRanks; n++)
+                {
+                    columns[f][1 + n].push_back(jet.signedIP2D[n]);
+                }
+            }
+
+            TrackCountingSkimBlock block{};
+            buffer.clear();
+            for (int f = 0; f < kNFlavors; f++)
+            {
+                block.nJets[f] = columns[f][0].size();
+                for (auto &column : columns[f])
+                {
+                    column.resize(trackCountingSkimPadded(column.size()), 0.f);
+                    buffer.insert(buffer.end(), column.begin(), column.end());
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(outMutex);
+            block.offset = end;
+            if (fseeko(out, end, SEEK_SET) != 0 or (!buffer.empty() and fwrite(buffer.data(), sizeof(float), buffer.size(), out) != buffer.size()))
+            {
+                ok = false;
+            }
+            end += buffer.size() * sizeof(float);
+            blocks[k].push_back(block);
+        }
+    };
+    if (nThreads == 1)
+    {
+        for (unsigned k = 0; k < ranges.size(); k++)
+        {
+            skimRange(k);
+        }
+    }
+    else
+    {
+        ROOT::EnableThreadSafety();
+        ROOT::TThreadExecutor pool(nThreads);
+        pool.Foreach(skimRange, ROOT::TSeqU(ranges.size()));
+    }
+
+    // index of the blocks in entry order, then header
+    header.indexOffset = end;
+    for (const auto &rangeBlocks : blocks)
+    {
+        for (const auto &block : rangeBlocks)
+        {
+            ok = ok and fseeko(out, end, SEEK_SET) == 0 and fwrite(&block, sizeof(block), 1, out) == 1;
+            end += sizeof(block);
+            header.nBlocks++;
+        }
+    }
+    memcpy(header.magic, kSkimMagic, sizeof(kSkimMagic));
+    header.version = kSkimVersion;
+    header.nRanks = kNRanks;
+    header.sourceSize = source.fSize;
+    header.sourceMTime = source.fMtime;
+    strncpy(header.treeName, treeName, sizeof(header.treeName) - 1);
+    header.nEntries = nEntries;
+    ok = ok and fseeko(out, 0, SEEK_SET) == 0 and fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = (fclose(out) == 0) and ok;
+
+    if (!ok or rename(tmpName.c_str(), skimName) != 0)
+    {
+        printf("buildTrackCountingSkim: cannot write %s\n", skimName);
+        remove(tmpName.c_str());
+        return false;
+    }
+    printf("buildTrackCountingSkim: %lld entries of %s skimmed to %s\n", nEntries, fileName, skimName);
+    return true;
+}
+
+/// Fills the bank with the blocks [firstBlock, lastBlock) of the skim
+inline void fillTrackCountingBankFromSkim(const TrackCountingSkim &skim, TrackCountingBank &bank, int64_t firstBlock, int64_t lastBlock)
+{
+    const float *signedIP2D[kNRanks];
+    for (int64_t b = firstBlock; b < lastBlock; b++)
+    {
+        const TrackCountingSkimBlock &block = skim.block(b);
+        for (int f = 0; f < kNFlavors; f++)
+        {
+            for (int n = 0; n < kNRanks; n++)
+            {
+                signedIP2D[n] = skim.column(block, f, 1 + n);
+            }
+            bank.fillColumns(f, block.nJets[f], skim.column(block, f, 0), signedIP2D);
+        }
+    }
+}
+
+#endif // TRACKCOUNTINGSKIM_H_